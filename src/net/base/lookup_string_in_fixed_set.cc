@@ -4,197 +4,200 @@
 
 #include "net/base/lookup_string_in_fixed_set.h"
 
-#include "base/check.h"
-
-namespace net {
-
-namespace {
-
-// Read next offset from |pos|, increment |offset| by that amount, and increment
-// |pos| either to point to the start of the next encoded offset in its node, or
-// nullptr, if there are no remaining offsets.
-//
-// Returns true if an offset could be read; false otherwise.
-inline bool GetNextOffset(const unsigned char** pos,
-                          const unsigned char** offset) {
-  if (*pos == nullptr)
-    return false;
-
-  size_t bytes_consumed;
-  switch (**pos & 0x60) {
-    case 0x60:  // Read three byte offset
-      *offset += (((*pos)[0] & 0x1F) << 16) | ((*pos)[1] << 8) | (*pos)[2];
-      bytes_consumed = 3;
-      break;
-    case 0x40:  // Read two byte offset
-      *offset += (((*pos)[0] & 0x1F) << 8) | (*pos)[1];
-      bytes_consumed = 2;
-      break;
-    default:
-      *offset += (*pos)[0] & 0x3F;
-      bytes_consumed = 1;
-  }
-  if ((**pos & 0x80) != 0) {
-    *pos = nullptr;
-  } else {
-    *pos += bytes_consumed;
-  }
-  return true;
-}
-
-// Check if byte at |offset| is last in label.
-bool IsEOL(const unsigned char* offset) {
-  return (*offset & 0x80) != 0;
-}
+#include <algorithm>
+#include <type_traits>
 
-// Check if byte at |offset| matches key. This version matches both end-of-label
-// chars and not-end-of-label chars.
-bool IsMatch(const unsigned char* offset, char key) {
-  return (*offset & 0x7F) == key;
-}
+#include "base/bits.h"
+#include "base/check.h"
+#include "base/check_op.h"
+#include "base/containers/stack_container.h"
+#include "build/build_config.h"
 
-// Read return value at |offset|, if it is a return value. Returns true if a
-// return value could be read, false otherwise.
-bool GetReturnValue(const unsigned char* offset, int* return_value) {
-  // Return values are always encoded as end-of-label chars (so the high bit is
-  // set). So byte values in the inclusive range [0x80, 0x9F] encode the return
-  // values 0 through 31 (though make_dafsa.py doesn't currently encode values
-  // higher than 7). The following code does that translation.
-  if ((*offset & 0xE0) == 0x80) {
-    *return_value = *offset & 0x1F;
-    return true;
-  }
-  return false;
-}
+#if defined(ARCH_CPU_X86_FAMILY)
+#include <emmintrin.h>
+#endif
 
-}  // namespace
+namespace net {
 
 FixedSetIncrementalLookup::FixedSetIncrementalLookup(const unsigned char* graph,
                                                      size_t length)
-    : pos_(graph), end_(graph + length), pos_is_label_character_(false) {}
+    : FixedSetIncrementalLookup(graph, length, nullptr) {}
 
 FixedSetIncrementalLookup::FixedSetIncrementalLookup(
-    const FixedSetIncrementalLookup& other) = default;
-
-FixedSetIncrementalLookup& FixedSetIncrementalLookup::operator=(
-    const FixedSetIncrementalLookup& other) = default;
-
-FixedSetIncrementalLookup::~FixedSetIncrementalLookup() = default;
-
-bool FixedSetIncrementalLookup::Advance(char input) {
-  if (!pos_) {
-    // A previous input exhausted the graph, so there are no possible matches.
-    return false;
-  }
+    const unsigned char* graph,
+    size_t length,
+    const DafsaFastDispatch* dispatch)
+    : graph_(graph),
+      graph_length_(static_cast<uint32_t>(length)),
+      pos_offset_(0),
+      dispatch_(dispatch),
+      fast_row_(dispatch != nullptr && dispatch->num_rows > 0 ? 0 : kNoFastRow)
+#if DCHECK_IS_ON()
+      ,
+      end_(graph + length)
+#endif
+{
+  DCHECK_LT(length, static_cast<size_t>(kGraphExhausted));
+}
 
-  // Only ASCII printable chars are supported by the current DAFSA format -- the
-  // high bit (values 0x80-0xFF) is reserved as a label-end signifier, and the
-  // low values (values 0x00-0x1F) are reserved to encode the return values. So
-  // values outside this range will never be in the dictionary.
-  if (input >= 0x20) {
-    if (pos_is_label_character_) {
-      // Currently processing a label, so it is only necessary to check the byte
-      // at |pos_| to see if it encodes a character matching |input|.
-      bool is_last_char_in_label = IsEOL(pos_);
-      bool is_match = IsMatch(pos_, input);
-      if (is_match) {
-        // If this is not the last character in the label, the next byte should
-        // be interpreted as a character or return value. Otherwise, the next
-        // byte should be interpreted as a list of child node offsets.
-        ++pos_;
-        DCHECK(pos_ < end_);
-        pos_is_label_character_ = !is_last_char_in_label;
-        return true;
-      }
-    } else {
-      const unsigned char* offset = pos_;
-      // Read offsets from |pos_| until the label of the child node at |offset|
-      // matches |input|, or until there are no more offsets.
-      while (GetNextOffset(&pos_, &offset)) {
-        DCHECK(offset < end_);
-        DCHECK((pos_ == nullptr) || (pos_ < end_));
-
-        // |offset| points to a DAFSA node that is a child of the original node.
-        //
-        // The low 7 bits of a node encodes a character value; the high bit
-        // indicates whether it's the last character in the label.
-        //
-        // Note that |*offset| could also be a result code value, but these are
-        // really just out-of-range ASCII values, encoded the same way as
-        // characters. Since |input| was already validated as a printable ASCII
-        // value ASCII value, IsMatch will never return true if |offset| is a
-        // result code.
-        bool is_last_char_in_label = IsEOL(offset);
-        bool is_match = IsMatch(offset, input);
-
-        if (is_match) {
-          // If this is not the last character in the label, the next byte
-          // should be interpreted as a character or return value. Otherwise,
-          // the next byte should be interpreted as a list of child node
-          // offsets.
-          pos_ = offset + 1;
-          DCHECK(pos_ < end_);
-          pos_is_label_character_ = !is_last_char_in_label;
-          return true;
+// Save/restore of the lookup state in callers' backtracking loops should
+// compile down to plain register or memcpy copies.
+static_assert(std::is_trivially_copyable<FixedSetIncrementalLookup>::value,
+              "FixedSetIncrementalLookup should be trivially copyable");
+
+size_t FixedSetIncrementalLookup::AdvanceCharacters(const char* input,
+                                                    size_t length) {
+  size_t consumed = 0;
+  while (consumed < length) {
+#if defined(ARCH_CPU_X86_FAMILY)
+    // When inside a multi-character label (and outside the dispatch-table
+    // region, which tracks its own rows), match the label bytes against the
+    // input in 16-byte blocks. The loads are bounded by the ends of the
+    // input and of the graph; short tails fall through to Advance() below.
+    if (fast_row_ == kNoFastRow && (pos_offset_ & kLabelCharacterBit)) {
+      const unsigned char* pos = graph_ + (pos_offset_ & kPositionMask);
+      while (length - consumed >= 16 &&
+             static_cast<size_t>(pos - graph_) + 16 <= graph_length_) {
+        const __m128i label =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+        const __m128i key = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(input + consumed));
+        // The high bit of a label byte marks the last character of the label.
+        const uint32_t eol_mask = _mm_movemask_epi8(label);
+        // A character matches if it equals the low 7 bits of the label byte
+        // and is printable ASCII; the signed compare against 0x1F rejects
+        // both control characters and bytes with the high bit set, which
+        // could otherwise alias return codes and end-of-label markers.
+        const __m128i label_chars =
+            _mm_and_si128(label, _mm_set1_epi8(0x7f));
+        const uint32_t eq_mask =
+            _mm_movemask_epi8(_mm_cmpeq_epi8(label_chars, key));
+        const uint32_t printable_mask =
+            _mm_movemask_epi8(_mm_cmpgt_epi8(key, _mm_set1_epi8(0x1f)));
+        const uint32_t mismatch_mask = ~(eq_mask & printable_mask) & 0xffff;
+        const size_t first_mismatch = std::min<size_t>(
+            base::bits::CountTrailingZeroBits(mismatch_mask), 16);
+        const size_t first_eol = std::min<size_t>(
+            eol_mask ? base::bits::CountTrailingZeroBits(eol_mask) : 16, 16);
+
+        if (first_eol < first_mismatch) {
+          // Every character through the end of the label matched; the next
+          // state is the node's offset list. Return to the per-character
+          // dispatch below for the next character.
+          consumed += first_eol + 1;
+          pos += first_eol + 1;
+          DCheckGraphPointer(pos);
+          pos_offset_ = static_cast<uint32_t>(pos - graph_);
+          break;
         }
+        if (first_mismatch < 16) {
+          // A character mismatched before the end of the label, so the graph
+          // is exhausted. The characters before the mismatch were consumed.
+          pos_offset_ = kGraphExhausted;
+          return consumed + first_mismatch;
+        }
+        // The whole block matched inside the label; keep going.
+        consumed += 16;
+        pos += 16;
+        DCheckGraphPointer(pos);
+        pos_offset_ = static_cast<uint32_t>(pos - graph_) | kLabelCharacterBit;
       }
+      if (consumed == length)
+        break;
     }
+#endif
+    if (!Advance(input[consumed]))
+      return consumed;
+    ++consumed;
   }
-
-  // If no match was found, then end of the DAFSA has been reached.
-  pos_ = nullptr;
-  pos_is_label_character_ = false;
-  return false;
+  return consumed;
 }
 
-int FixedSetIncrementalLookup::GetResultForCurrentSequence() const {
-  int value = kDafsaNotFound;
-  // Look to see if there is a next character that's a return value.
-  if (pos_is_label_character_) {
-    // Currently processing a label, so it is only necessary to check the byte
-    // at |pos_| to see if encodes a return value.
-    GetReturnValue(pos_, &value);
-  } else {
-    // Otherwise, |pos_| is an offset list (or nullptr). Explore the list of
-    // child nodes (given by their offsets) to find one whose label is a result
-    // code.
-    //
-    // This search uses a temporary copy of |pos_|, since mutating |pos_| could
-    // skip over a node that would be important to a subsequent Advance() call.
-    const unsigned char* temp_pos = pos_;
-
-    // Read offsets from |temp_pos| until either |temp_pos| is nullptr or until
-    // the byte at |offset| contains a result code (encoded as an ASCII
-    // character below 0x20).
-    const unsigned char* offset = pos_;
-    while (GetNextOffset(&temp_pos, &offset)) {
-      DCHECK(offset < end_);
-      DCHECK((temp_pos == nullptr) || temp_pos < end_);
-      if (GetReturnValue(offset, &value))
-        break;
-    }
-  }
-  return value;
+int LookupStringInFixedSet(const unsigned char* graph,
+                           size_t length,
+                           const char* key,
+                           size_t key_length) {
+  return LookupStringInFixedSet(graph, length, nullptr, key, key_length);
 }
 
 int LookupStringInFixedSet(const unsigned char* graph,
                            size_t length,
+                           const DafsaFastDispatch* dispatch,
                            const char* key,
                            size_t key_length) {
   // Do an incremental lookup until either the end of the graph is reached, or
   // until every character in |key| is consumed.
-  FixedSetIncrementalLookup lookup(graph, length);
-  const char* key_end = key + key_length;
-  while (key != key_end) {
-    if (!lookup.Advance(*key))
-      return kDafsaNotFound;
-    key++;
-  }
+  FixedSetIncrementalLookup lookup(graph, length, dispatch);
+  if (lookup.AdvanceCharacters(key, key_length) != key_length)
+    return kDafsaNotFound;
   // The entire input was consumed without reaching the end of the graph. Return
   // the result code (if present) for the current position, or kDafsaNotFound.
   return lookup.GetResultForCurrentSequence();
 }
 
+void LookupStringsInFixedSet(const unsigned char* graph,
+                             size_t length,
+                             const char* const* keys,
+                             const size_t* key_lengths,
+                             int* results,
+                             size_t num_keys) {
+  // The number of lookups stepped in lockstep. Enough in-flight traversals to
+  // cover main-memory latency with useful work, while the per-lane state
+  // still fits comfortably in L1.
+  constexpr size_t kLanes = 8;
+
+  struct Lane {
+    Lane(const unsigned char* graph,
+         size_t length,
+         const char* key,
+         size_t key_length,
+         int* result)
+        : lookup(graph, length),
+          next(key),
+          end(key + key_length),
+          result(result) {}
+
+    FixedSetIncrementalLookup lookup;
+    const char* next;
+    const char* end;
+    int* result;
+  };
+
+  base::StackVector<Lane, kLanes> lanes;
+  for (size_t batch_start = 0; batch_start < num_keys; batch_start += kLanes) {
+    const size_t batch_size = std::min(kLanes, num_keys - batch_start);
+    lanes->clear();
+    for (size_t i = 0; i < batch_size; ++i) {
+      lanes->emplace_back(graph, length, keys[batch_start + i],
+                          key_lengths[batch_start + i],
+                          &results[batch_start + i]);
+    }
+
+    size_t num_active = lanes->size();
+    while (num_active > 0) {
+      // Request every active lane's next graph bytes before any lane touches
+      // the graph, so the loads overlap.
+      for (size_t i = 0; i < num_active; ++i)
+        lanes[i].lookup.PrefetchCurrentPosition();
+
+      // Advance each active lane by one character, compacting the lanes that
+      // remain active to the front of the array.
+      size_t num_still_active = 0;
+      for (size_t i = 0; i < num_active; ++i) {
+        Lane& lane = lanes[i];
+        if (lane.next == lane.end) {
+          *lane.result = lane.lookup.GetResultForCurrentSequence();
+        } else if (!lane.lookup.Advance(*lane.next++)) {
+          *lane.result = kDafsaNotFound;
+        } else {
+          lanes[num_still_active++] = lane;
+        }
+      }
+      num_active = num_still_active;
+    }
+  }
+}
+
 // This function is only used by GetRegistryLengthInStrippedHost(), but is
 // implemented here to allow inlining of
 // LookupStringInFixedSet::GetResultForCurrentSequence() and
@@ -206,7 +209,17 @@ int LookupSuffixInReversedSet(const unsigned char* graph,
                               bool include_private,
                               base::StringPiece host,
                               size_t* suffix_length) {
-  FixedSetIncrementalLookup lookup(graph, length);
+  return LookupSuffixInReversedSet(graph, length, nullptr, include_private,
+                                   host, suffix_length);
+}
+
+int LookupSuffixInReversedSet(const unsigned char* graph,
+                              size_t length,
+                              const DafsaFastDispatch* dispatch,
+                              bool include_private,
+                              base::StringPiece host,
+                              size_t* suffix_length) {
+  FixedSetIncrementalLookup lookup(graph, length, dispatch);
   *suffix_length = 0;
   int result = kDafsaNotFound;
   base::StringPiece::const_iterator pos = host.end();
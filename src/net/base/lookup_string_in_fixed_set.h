@@ -6,7 +6,10 @@
 #define NET_BASE_LOOKUP_STRING_IN_FIXED_SET_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
+#include "base/check.h"
+#include "base/compiler_specific.h"
 #include "base/strings/string_piece.h"
 #include "net/base/net_export.h"
 
@@ -38,6 +41,24 @@ NET_EXPORT int LookupStringInFixedSet(const unsigned char* graph,
                                       const char* key,
                                       size_t key_length);
 
+// Looks up each of the |num_keys| strings given by |keys| and |key_lengths|
+// in a fixed set described by |graph| and |length|, writing the result for
+// each key (with the same meaning as the return value of
+// LookupStringInFixedSet) to the corresponding element of |results|.
+//
+// The lookups are advanced in lockstep, a character at a time across the
+// whole batch, with the graph bytes needed by each lookup prefetched before
+// they are touched. Since each traversal is a serial pointer-chase through
+// the graph, this overlaps the memory latency of one lookup with work on the
+// others, and is faster than looking the keys up one at a time when many keys
+// are checked at once.
+NET_EXPORT void LookupStringsInFixedSet(const unsigned char* graph,
+                                        size_t length,
+                                        const char* const* keys,
+                                        const size_t* key_lengths,
+                                        int* results,
+                                        size_t num_keys);
+
 // Looks up the longest matching suffix for |host| with length |length| in a
 // reversed DAFSA. Partial matches must begin at a new component, i.e. host
 // itself could match or a host part starting after a dot could match.
@@ -50,6 +71,42 @@ int LookupSuffixInReversedSet(const unsigned char* graph,
                               base::StringPiece host,
                               size_t* suffix_length);
 
+// A direct-index dispatch table for the hottest nodes of a DAFSA, emitted by
+// make_dafsa.py alongside the byte array when it is run with --fast-dispatch.
+// Row 0 describes the root node and the remaining rows describe the states
+// one transition away from it, which every successful lookup passes through.
+//
+// states[row * 128 + c] holds the lookup state reached from |row| on input
+// character |c|, in the same packed format as FixedSetIncrementalLookup's
+// internal state, or 0x7FFFFFFF if there is no such transition.
+// rows[row * 128 + c] holds the table row describing that next state, or 0xFF
+// if the next state is outside the table.
+struct DafsaFastDispatch {
+  const uint32_t* states;
+  const uint8_t* rows;
+  size_t num_rows;
+};
+
+// As LookupStringInFixedSet() above, but additionally consults |dispatch|,
+// the dispatch table generated for |graph| by make_dafsa.py --fast-dispatch.
+// This resolves the first characters of the key with single table loads
+// instead of interpreting the graph bytes. |dispatch| may be null.
+NET_EXPORT int LookupStringInFixedSet(const unsigned char* graph,
+                                      size_t length,
+                                      const DafsaFastDispatch* dispatch,
+                                      const char* key,
+                                      size_t key_length);
+
+// As LookupSuffixInReversedSet() above, but additionally consults |dispatch|,
+// the dispatch table generated for |graph| by make_dafsa.py --fast-dispatch.
+// |dispatch| may be null.
+int LookupSuffixInReversedSet(const unsigned char* graph,
+                              size_t length,
+                              const DafsaFastDispatch* dispatch,
+                              bool include_private,
+                              base::StringPiece host,
+                              size_t* suffix_length);
+
 // FixedSetIncrementalLookup provides efficient membership and prefix queries
 // against a fixed set of strings. The set of strings must be known at compile
 // time. The set is converted to a graph structure named a DAFSA (Deterministic
@@ -103,14 +160,24 @@ class NET_EXPORT FixedSetIncrementalLookup {
   // GetResultForCurrentSequence().
   FixedSetIncrementalLookup(const unsigned char* graph, size_t length);
 
+  // Begin a lookup that consults |dispatch|, the compiled dispatch table
+  // generated for this graph by make_dafsa.py --fast-dispatch, before falling
+  // back to interpreting the graph bytes. |dispatch| must outlive this
+  // object.
+  FixedSetIncrementalLookup(const unsigned char* graph,
+                            size_t length,
+                            const DafsaFastDispatch* dispatch);
+
   // FixedSetIncrementalLookup is copyable so that callers can save/restore
   // their position in the search. This is for cases where branching or
   // backtracking might be required (e.g. to probe for the presence of a
-  // designated wildcard character).
-  FixedSetIncrementalLookup(const FixedSetIncrementalLookup&);
-  FixedSetIncrementalLookup& operator=(const FixedSetIncrementalLookup&);
+  // designated wildcard character). The class is deliberately kept trivially
+  // copyable so that such save/restore copies are cheap.
+  FixedSetIncrementalLookup(const FixedSetIncrementalLookup&) = default;
+  FixedSetIncrementalLookup& operator=(const FixedSetIncrementalLookup&) =
+      default;
 
-  ~FixedSetIncrementalLookup();
+  ~FixedSetIncrementalLookup() = default;
 
   // Advance the query by adding a character to the input sequence. |input| can
   // be any char value, but only ASCII characters will ever result in matches,
@@ -126,6 +193,15 @@ class NET_EXPORT FixedSetIncrementalLookup {
   // effect.
   bool Advance(char input);
 
+  // Advances the query by |length| characters from |input|, as if by calling
+  // Advance() once per character. Returns the number of characters consumed,
+  // which is less than |length| if and only if some character exhausted the
+  // graph. When the lookup is inside a multi-character label, consecutive
+  // label bytes are matched against the input in 16-byte blocks with SIMD
+  // compares where supported, so this is faster than per-character Advance()
+  // calls when the whole input is available up front.
+  size_t AdvanceCharacters(const char* input, size_t length);
+
   // Returns the result code corresponding to the input sequence provided thus
   // far to Advance().
   //
@@ -140,21 +216,298 @@ class NET_EXPORT FixedSetIncrementalLookup {
   // calling Advance().
   int GetResultForCurrentSequence() const;
 
+  // Hints the processor to load the graph bytes at the current position into
+  // cache. Used by LookupStringsInFixedSet to overlap the memory latency of
+  // one lookup's traversal with work on the others. Has no effect on the
+  // lookup state.
+  void PrefetchCurrentPosition() const {
+#if defined(__GNUC__) || defined(__clang__)
+    if (pos_offset_ != kGraphExhausted)
+      __builtin_prefetch(graph_ + (pos_offset_ & kPositionMask), 0, 0);
+#endif
+  }
+
  private:
-  // Pointer to the current position in the graph indicating the current state
-  // of the automaton, or nullptr if the graph is exhausted.
-  const unsigned char* pos_;
+  // Flag bit in |pos_offset_| that marks the current position as a label
+  // character (or return code) rather than an offset list.
+  static constexpr uint32_t kLabelCharacterBit = 0x80000000u;
 
-  // Pointer just past the end of the graph. |pos_| should never get here. This
-  // is used only in DCHECKs.
-  const unsigned char* end_;
+  // Mask selecting the position bits of |pos_offset_|.
+  static constexpr uint32_t kPositionMask = 0x7fffffffu;
+
+  // Position value indicating that the graph is exhausted. It cannot collide
+  // with a real position, since graphs are much smaller than 2 GiB. This
+  // value must match the no-transition entries that make_dafsa.py emits in
+  // DafsaFastDispatch tables.
+  static constexpr uint32_t kGraphExhausted = kPositionMask;
+
+  // Row value in DafsaFastDispatch::rows marking a state that has no row of
+  // its own. Must match make_dafsa.py.
+  static constexpr uint8_t kNoFastRow = 0xff;
+
+  // Hints the processor to load the graph bytes that the next Advance() is
+  // likely to touch, given the just-updated |pos_offset_|. Traversal is a
+  // dependent pointer chase, so requesting the next node's bytes while the
+  // caller is still working on the current character hides part of the cache
+  // miss latency of the following transition. Has no effect on the lookup
+  // state.
+  void PrefetchNextNode() const;
+
+  // DCHECKs that |pos| is either nullptr or within the graph. |end_| is only
+  // stored in DCHECK-enabled builds, so this is a no-op elsewhere.
+  void DCheckGraphPointer(const unsigned char* pos) const {
+#if DCHECK_IS_ON()
+    DCHECK(pos == nullptr || pos < end_);
+#endif
+  }
 
-  // Contains the current decoder state. If true, |pos_| points to a label
-  // character or a return code. If false, |pos_| points to a sequence of
-  // offsets that indicate the child nodes of the current state.
-  bool pos_is_label_character_;
+  // Base of the DAFSA byte array described in the class comment.
+  const unsigned char* graph_;
+
+  // Length of the graph in bytes. Used to bound the block loads performed by
+  // AdvanceCharacters.
+  uint32_t graph_length_;
+
+  // The current state of the automaton, packed into one word so that testing
+  // the decoder state is a single bit test rather than a separate load. The
+  // low 31 bits hold the byte offset of the current position from |graph_|,
+  // or kGraphExhausted once the graph is exhausted. The top bit is set if the
+  // position is a label character or a return code, and clear if it is a
+  // sequence of offsets that indicate the child nodes of the current state.
+  uint32_t pos_offset_;
+
+  // The compiled dispatch table for the hottest nodes of |graph_|, or nullptr
+  // if none was supplied.
+  const DafsaFastDispatch* dispatch_;
+
+  // The row of |dispatch_| describing the current position, or kNoFastRow if
+  // the position is outside the table. Always kNoFastRow when |dispatch_| is
+  // null.
+  uint8_t fast_row_;
+
+#if DCHECK_IS_ON()
+  // Pointer just past the end of the graph. The current position should never
+  // get here. This is used only in DCHECKs, and is not stored in other
+  // builds.
+  const unsigned char* end_;
+#endif
 };
 
+// The definitions of the per-character lookup path live here in the header
+// so that callers in other translation units can inline them. Advance() and
+// GetResultForCurrentSequence() are called once per input character in the
+// hot loops of GetRegistryLength() and the HSTS preload check, where the
+// call overhead itself is measurable.
+
+namespace dafsa_internal {
+
+// Implementation helpers for the inline member functions below. Not part
+// of the public interface.
+
+// Read next offset from |pos|, increment |offset| by that amount, and increment
+// |pos| either to point to the start of the next encoded offset in its node, or
+// nullptr, if there are no remaining offsets.
+//
+// Returns true if an offset could be read; false otherwise.
+ALWAYS_INLINE bool GetNextOffset(const unsigned char** pos,
+                                 const unsigned char** offset) {
+  if (*pos == nullptr)
+    return false;
+
+  size_t bytes_consumed;
+  switch (**pos & 0x60) {
+    case 0x60:  // Read three byte offset
+      *offset += (((*pos)[0] & 0x1F) << 16) | ((*pos)[1] << 8) | (*pos)[2];
+      bytes_consumed = 3;
+      break;
+    case 0x40:  // Read two byte offset
+      *offset += (((*pos)[0] & 0x1F) << 8) | (*pos)[1];
+      bytes_consumed = 2;
+      break;
+    default:
+      *offset += (*pos)[0] & 0x3F;
+      bytes_consumed = 1;
+  }
+  if ((**pos & 0x80) != 0) {
+    *pos = nullptr;
+  } else {
+    *pos += bytes_consumed;
+  }
+  return true;
+}
+
+// Check if byte at |offset| is last in label.
+ALWAYS_INLINE bool IsEOL(const unsigned char* offset) {
+  return (*offset & 0x80) != 0;
+}
+
+// Check if byte at |offset| matches key. This version matches both end-of-label
+// chars and not-end-of-label chars.
+ALWAYS_INLINE bool IsMatch(const unsigned char* offset, char key) {
+  return (*offset & 0x7F) == key;
+}
+
+// Read return value at |offset|, if it is a return value. Returns true if a
+// return value could be read, false otherwise.
+ALWAYS_INLINE bool GetReturnValue(const unsigned char* offset,
+                                  int* return_value) {
+  // Return values are always encoded as end-of-label chars (so the high bit is
+  // set). So byte values in the inclusive range [0x80, 0x9F] encode the return
+  // values 0 through 31 (though make_dafsa.py doesn't currently encode values
+  // higher than 7). The following code does that translation.
+  if ((*offset & 0xE0) == 0x80) {
+    *return_value = *offset & 0x1F;
+    return true;
+  }
+  return false;
+}
+
+}  // namespace dafsa_internal
+
+inline void FixedSetIncrementalLookup::PrefetchNextNode() const {
+#if defined(__GNUC__) || defined(__clang__)
+  if (pos_offset_ == kGraphExhausted)
+    return;
+  const unsigned char* pos = graph_ + (pos_offset_ & kPositionMask);
+  __builtin_prefetch(pos, 0, 0);
+  if (!(pos_offset_ & kLabelCharacterBit)) {
+    // The position is an offset list. A matching transition jumps to the
+    // target of one of its offsets, and the first child is the most likely
+    // landing spot. The offset bytes themselves share the current node's
+    // cache line, but the target can be far away, so request it too.
+    const unsigned char* target = pos;
+    if (dafsa_internal::GetNextOffset(&pos, &target))
+      __builtin_prefetch(target, 0, 0);
+  }
+#endif
+}
+
+ALWAYS_INLINE bool FixedSetIncrementalLookup::Advance(char input) {
+  if (pos_offset_ == kGraphExhausted) {
+    // A previous input exhausted the graph, so there are no possible matches.
+    return false;
+  }
+
+  // Only ASCII printable chars are supported by the current DAFSA format -- the
+  // high bit (values 0x80-0xFF) is reserved as a label-end signifier, and the
+  // low values (values 0x00-0x1F) are reserved to encode the return values. So
+  // values outside this range will never be in the dictionary.
+  if (input >= 0x20) {
+    // Rows are 128 entries wide, so the dispatch path must only see 7-bit
+    // characters. On platforms where plain char is unsigned, bytes 0x80-0xFF
+    // pass the check above; they can never match, which the interpreter paths
+    // below establish via IsMatch's "& 0x7F", so send them there.
+    if (fast_row_ != kNoFastRow && static_cast<unsigned char>(input) < 0x80) {
+      // The current state has a compiled dispatch row, so a single indexed
+      // load replaces the label test or offset-list scan below.
+      const size_t index =
+          static_cast<size_t>(fast_row_) * 128 + static_cast<uint8_t>(input);
+      const uint32_t next_state = dispatch_->states[index];
+      fast_row_ = dispatch_->rows[index];
+      pos_offset_ = next_state;
+      if (fast_row_ == kNoFastRow && next_state != kGraphExhausted) {
+        // Leaving the dispatch table; the next transition interprets the
+        // graph bytes, so start loading them now.
+        PrefetchNextNode();
+      }
+      return next_state != kGraphExhausted;
+    }
+    if (pos_offset_ & kLabelCharacterBit) {
+      // Currently processing a label, so it is only necessary to check the
+      // byte at the current position to see if it encodes a character matching
+      // |input|.
+      const unsigned char* pos = graph_ + (pos_offset_ & kPositionMask);
+      bool is_last_char_in_label = dafsa_internal::IsEOL(pos);
+      bool is_match = dafsa_internal::IsMatch(pos, input);
+      if (is_match) {
+        // If this is not the last character in the label, the next byte should
+        // be interpreted as a character or return value. Otherwise, the next
+        // byte should be interpreted as a list of child node offsets.
+        ++pos;
+        DCheckGraphPointer(pos);
+        pos_offset_ = static_cast<uint32_t>(pos - graph_) |
+                      (is_last_char_in_label ? 0 : kLabelCharacterBit);
+        PrefetchNextNode();
+        return true;
+      }
+    } else {
+      const unsigned char* pos = graph_ + pos_offset_;
+      const unsigned char* offset = pos;
+      // Read offsets from |pos| until the label of the child node at |offset|
+      // matches |input|, or until there are no more offsets.
+      while (dafsa_internal::GetNextOffset(&pos, &offset)) {
+        DCheckGraphPointer(offset);
+        DCheckGraphPointer(pos);
+
+        // |offset| points to a DAFSA node that is a child of the original node.
+        //
+        // The low 7 bits of a node encodes a character value; the high bit
+        // indicates whether it's the last character in the label.
+        //
+        // Note that |*offset| could also be a result code value, but these are
+        // really just out-of-range ASCII values, encoded the same way as
+        // characters. Since |input| was already validated as a printable ASCII
+        // value ASCII value, IsMatch will never return true if |offset| is a
+        // result code.
+        bool is_last_char_in_label = dafsa_internal::IsEOL(offset);
+        bool is_match = dafsa_internal::IsMatch(offset, input);
+
+        if (is_match) {
+          // If this is not the last character in the label, the next byte
+          // should be interpreted as a character or return value. Otherwise,
+          // the next byte should be interpreted as a list of child node
+          // offsets.
+          DCheckGraphPointer(offset + 1);
+          pos_offset_ = static_cast<uint32_t>(offset + 1 - graph_) |
+                        (is_last_char_in_label ? 0 : kLabelCharacterBit);
+          PrefetchNextNode();
+          return true;
+        }
+      }
+    }
+  }
+
+  // If no match was found, then end of the DAFSA has been reached.
+  pos_offset_ = kGraphExhausted;
+  fast_row_ = kNoFastRow;
+  return false;
+}
+
+inline int FixedSetIncrementalLookup::GetResultForCurrentSequence() const {
+  int value = kDafsaNotFound;
+  if (pos_offset_ == kGraphExhausted) {
+    return value;
+  }
+  // Look to see if there is a next character that's a return value.
+  if (pos_offset_ & kLabelCharacterBit) {
+    // Currently processing a label, so it is only necessary to check the byte
+    // at the current position to see if it encodes a return value.
+    dafsa_internal::GetReturnValue(graph_ + (pos_offset_ & kPositionMask),
+                                   &value);
+  } else {
+    // Otherwise, the current position is an offset list. Explore the list of
+    // child nodes (given by their offsets) to find one whose label is a result
+    // code.
+    //
+    // This search uses a local copy of the position, since mutating the saved
+    // state could skip over a node that would be important to a subsequent
+    // Advance() call.
+    const unsigned char* temp_pos = graph_ + pos_offset_;
+
+    // Read offsets from |temp_pos| until either |temp_pos| is nullptr or until
+    // the byte at |offset| contains a result code (encoded as an ASCII
+    // character below 0x20).
+    const unsigned char* offset = graph_ + pos_offset_;
+    while (dafsa_internal::GetNextOffset(&temp_pos, &offset)) {
+      DCheckGraphPointer(offset);
+      DCheckGraphPointer(temp_pos);
+      if (dafsa_internal::GetReturnValue(offset, &value))
+        break;
+    }
+  }
+  return value;
+}
+
 }  // namespace net
 
 #endif  // NET_BASE_LOOKUP_STRING_IN_FIXED_SET_H_
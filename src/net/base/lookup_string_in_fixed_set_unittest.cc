@@ -16,6 +16,7 @@
 #include "base/files/file_path.h"
 #include "base/files/file_util.h"
 #include "base/path_service.h"
+#include "base/stl_util.h"
 #include "base/strings/string_util.h"
 #include "base/strings/stringprintf.h"
 #include "testing/gtest/include/gtest/gtest.h"
@@ -62,6 +63,65 @@ TEST_P(Dafsa1Test, BasicTest) {
   EXPECT_EQ(param.value, LookupInGraph(test1::kDafsa, param.key));
 }
 
+// A lookup through the dispatch tables generated by --fast-dispatch must
+// produce exactly the result of interpreting the graph bytes.
+TEST_P(Dafsa1Test, BasicTestWithFastDispatch) {
+  const Expectation& param = GetParam();
+  DafsaFastDispatch dispatch;
+  dispatch.states = &test1::kDafsaFastStates[0][0];
+  dispatch.rows = &test1::kDafsaFastRows[0][0];
+  dispatch.num_rows = base::size(test1::kDafsaFastStates);
+
+  FixedSetIncrementalLookup lookup(test1::kDafsa, sizeof(test1::kDafsa),
+                                   &dispatch);
+  int result = kDafsaFound;
+  for (const char* p = param.key; *p; ++p) {
+    if (!lookup.Advance(*p)) {
+      result = kDafsaNotFound;
+      break;
+    }
+  }
+  if (result != kDafsaNotFound)
+    result = lookup.GetResultForCurrentSequence();
+  EXPECT_EQ(param.value, result);
+}
+
+// The dispatch tables are 128 entries per row, so characters with the high
+// bit set (as well as control characters) must never reach them; they can
+// occur at any position when plain char is unsigned. Check that such bytes
+// exhaust the graph through the dispatch-backed lookup exactly as they do
+// through the plain interpreter, both as the first character and after a
+// transition that lands inside the dispatch table.
+TEST(LookupStringInFixedSetTest, FastDispatchRejectsOutOfRangeBytes) {
+  DafsaFastDispatch dispatch;
+  dispatch.states = &test1::kDafsaFastStates[0][0];
+  dispatch.rows = &test1::kDafsaFastRows[0][0];
+  dispatch.num_rows = base::size(test1::kDafsaFastStates);
+
+  const char kOutOfRangeChars[] = {'\x80', '\xff', '\xe9', '\x01', '\x1f'};
+  for (char bad : kOutOfRangeChars) {
+    for (const std::string& prefix : {std::string(), std::string("j")}) {
+      for (const std::string& key :
+           {prefix + bad, prefix + bad + "jp", prefix + bad + "p"}) {
+        FixedSetIncrementalLookup plain(test1::kDafsa, sizeof(test1::kDafsa));
+        FixedSetIncrementalLookup fast(test1::kDafsa, sizeof(test1::kDafsa),
+                                       &dispatch);
+        for (size_t i = 0; i < key.size(); ++i) {
+          const bool plain_alive = plain.Advance(key[i]);
+          const bool fast_alive = fast.Advance(key[i]);
+          EXPECT_EQ(plain_alive, fast_alive)
+              << "character " << i << " of key with byte 0x" << std::hex
+              << (static_cast<unsigned>(bad) & 0xff);
+          EXPECT_EQ(plain.GetResultForCurrentSequence(),
+                    fast.GetResultForCurrentSequence());
+          if (!plain_alive)
+            break;
+        }
+      }
+    }
+  }
+}
+
 const Expectation kBasicTestCases[] = {
     {"", -1},      {"j", -1},          {"jp", 0}, {"jjp", -1}, {"jpp", -1},
     {"bar.jp", 2}, {"pref.bar.jp", 1}, {"c", 2},  {"b.c", 1},  {"priv.no", 4},
@@ -109,6 +169,56 @@ INSTANTIATE_TEST_SUITE_P(LookupStringInFixedSetTest,
                          Dafsa1Test,
                          ::testing::ValuesIn(kBasicTestCases));
 
+// AdvanceCharacters must consume exactly as many characters as repeated
+// Advance() calls would, including through the block-compare path taken for
+// the long labels of the two-byte-offset test graph.
+TEST(LookupStringInFixedSetTest, AdvanceCharactersMatchesAdvance) {
+  std::string in_set = "0" + std::string(100, '_') + "0";
+  std::string diverges_late = in_set.substr(0, 50) + "x" + in_set.substr(51);
+
+  for (const std::string& key : {in_set, diverges_late}) {
+    FixedSetIncrementalLookup by_char(test3::kDafsa, sizeof(test3::kDafsa));
+    size_t expected_consumed = 0;
+    for (char c : key) {
+      if (!by_char.Advance(c))
+        break;
+      ++expected_consumed;
+    }
+
+    FixedSetIncrementalLookup by_block(test3::kDafsa, sizeof(test3::kDafsa));
+    EXPECT_EQ(expected_consumed,
+              by_block.AdvanceCharacters(key.data(), key.size()));
+    EXPECT_EQ(by_char.GetResultForCurrentSequence(),
+              by_block.GetResultForCurrentSequence());
+  }
+}
+
+// The batched lookup must return exactly what per-key lookups return, for
+// batches both smaller and larger than its internal lane count.
+TEST(LookupStringsInFixedSetTest, MatchesSingleKeyLookups) {
+  std::vector<const char*> keys;
+  std::vector<size_t> key_lengths;
+  std::vector<int> expected;
+  // Repeat the basic cases so the batch spans several groups of lanes.
+  for (int repeat = 0; repeat < 3; ++repeat) {
+    for (const Expectation& expectation : kBasicTestCases) {
+      keys.push_back(expectation.key);
+      key_lengths.push_back(strlen(expectation.key));
+      expected.push_back(expectation.value);
+    }
+  }
+
+  std::vector<int> results(keys.size());
+  LookupStringsInFixedSet(test1::kDafsa, sizeof(test1::kDafsa), keys.data(),
+                          key_lengths.data(), results.data(), keys.size());
+  EXPECT_EQ(expected, results);
+}
+
+TEST(LookupStringsInFixedSetTest, EmptyBatch) {
+  LookupStringsInFixedSet(test1::kDafsa, sizeof(test1::kDafsa), nullptr,
+                          nullptr, nullptr, 0);
+}
+
 class Dafsa3Test : public LookupStringInFixedSetTest {};
 
 // This DAFSA is constructed so that labels begin and end with unique
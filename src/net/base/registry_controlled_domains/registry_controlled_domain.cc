@@ -47,6 +47,7 @@
 
 #include "base/check_op.h"
 #include "base/notreached.h"
+#include "base/stl_util.h"
 #include "base/strings/string_util.h"
 #include "base/strings/utf_string_conversions.h"
 #include "net/base/lookup_string_in_fixed_set.h"
@@ -63,11 +64,20 @@ namespace registry_controlled_domains {
 namespace {
 #include "net/base/registry_controlled_domains/effective_tld_names-reversed-inc.cc"
 
-// See make_dafsa.py for documentation of the generated dafsa byte array.
+// See make_dafsa.py for documentation of the generated dafsa byte array and
+// the fast dispatch tables.
+
+const DafsaFastDispatch kDafsaDispatch = {&kDafsaFastStates[0][0],
+                                          &kDafsaFastRows[0][0],
+                                          base::size(kDafsaFastStates)};
 
 const unsigned char* g_graph = kDafsa;
 size_t g_graph_length = sizeof(kDafsa);
 
+// Dispatch table for |g_graph|, or null when a graph without one has been
+// installed via SetFindDomainGraph().
+const DafsaFastDispatch* g_dispatch = &kDafsaDispatch;
+
 struct MappedHostComponent {
   size_t original_begin;
   size_t original_end;
@@ -83,8 +93,8 @@ size_t GetRegistryLengthInTrimmedHost(base::StringPiece host,
                                       PrivateRegistryFilter private_filter) {
   size_t length;
   int type = LookupSuffixInReversedSet(
-      g_graph, g_graph_length, private_filter == INCLUDE_PRIVATE_REGISTRIES,
-      host, &length);
+      g_graph, g_graph_length, g_dispatch,
+      private_filter == INCLUDE_PRIVATE_REGISTRIES, host, &length);
 
   DCHECK_LE(length, host.size());
 
@@ -458,6 +468,7 @@ size_t PermissiveGetHostRegistryLength(base::StringPiece16 host,
 void SetFindDomainGraph() {
   g_graph = kDafsa;
   g_graph_length = sizeof(kDafsa);
+  g_dispatch = &kDafsaDispatch;
 }
 
 void SetFindDomainGraph(const unsigned char* domains, size_t length) {
@@ -465,6 +476,8 @@ void SetFindDomainGraph(const unsigned char* domains, size_t length) {
   CHECK_NE(length, 0u);
   g_graph = domains;
   g_graph_length = length;
+  // Graphs installed for tests come without a dispatch table.
+  g_dispatch = nullptr;
 }
 
 }  // namespace registry_controlled_domains
@@ -3,8 +3,15 @@
 // found in the LICENSE file.
 
 #include "net/extras/preload_data/decoder.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "base/bits.h"
 #include "base/check_op.h"
 #include "base/notreached.h"
+#include "base/sys_byteorder.h"
 
 namespace net {
 
@@ -14,22 +21,50 @@ PreloadDecoder::BitReader::BitReader(const uint8_t* bytes, size_t num_bits)
     : bytes_(bytes),
       num_bits_(num_bits),
       num_bytes_((num_bits + 7) / 8),
-      current_byte_index_(0),
-      num_bits_used_(8) {}
+      buffer_(0),
+      num_buffered_bits_(0),
+      next_byte_index_(0) {}
+
+// Loads bytes from |bytes_| into |buffer_| until it holds at least 57 bits,
+// or until the input is exhausted.
+void PreloadDecoder::BitReader::Refill() {
+  if (num_buffered_bits_ <= 56 && next_byte_index_ + 8 <= num_bytes_) {
+    // Away from the end of the input, append as many whole bytes as fit
+    // below the buffered bits with a single unaligned load instead of a
+    // byte-at-a-time loop. This tops the buffer up to at least 57 bits.
+    uint64_t chunk;
+    memcpy(&chunk, bytes_ + next_byte_index_, sizeof(chunk));
+    chunk = base::NetToHost64(chunk);
+    const unsigned num_new_bytes = (64 - num_buffered_bits_) / 8;
+    // Mask off the bytes that do not fit; their bit positions alias bytes
+    // appended by future refills.
+    chunk &= ~uint64_t{0} << (64 - 8 * num_new_bytes);
+    buffer_ |= chunk >> num_buffered_bits_;
+    num_buffered_bits_ += 8 * num_new_bytes;
+    next_byte_index_ += num_new_bytes;
+    return;
+  }
+  while (num_buffered_bits_ <= 56 && next_byte_index_ < num_bytes_) {
+    buffer_ |= static_cast<uint64_t>(bytes_[next_byte_index_++])
+               << (56 - num_buffered_bits_);
+    num_buffered_bits_ += 8;
+  }
+}
 
 // Next sets |*out| to the next bit from the input. It returns false if no
 // more bits are available or true otherwise.
 bool PreloadDecoder::BitReader::Next(bool* out) {
-  if (num_bits_used_ == 8) {
-    if (current_byte_index_ >= num_bytes_) {
-      return false;
-    }
-    current_byte_ = bytes_[current_byte_index_++];
-    num_bits_used_ = 0;
+  if (remaining_bits() == 0) {
+    return false;
+  }
+  if (num_buffered_bits_ == 0) {
+    Refill();
   }
+  DCHECK_GT(num_buffered_bits_, 0u);
 
-  *out = 1 & (current_byte_ >> (7 - num_bits_used_));
-  num_bits_used_++;
+  *out = buffer_ >> 63;
+  buffer_ <<= 1;
+  num_buffered_bits_--;
   return true;
 }
 
@@ -39,16 +74,23 @@ bool PreloadDecoder::BitReader::Next(bool* out) {
 bool PreloadDecoder::BitReader::Read(unsigned num_bits, uint32_t* out) {
   DCHECK_LE(num_bits, 32u);
 
-  uint32_t ret = 0;
-  for (unsigned i = 0; i < num_bits; ++i) {
-    bool bit;
-    if (!Next(&bit)) {
-      return false;
-    }
-    ret |= static_cast<uint32_t>(bit) << (num_bits - 1 - i);
+  if (remaining_bits() < num_bits) {
+    return false;
+  }
+  if (num_bits == 0) {
+    *out = 0;
+    return true;
+  }
+  if (num_buffered_bits_ < num_bits) {
+    Refill();
   }
+  // After a refill, |buffer_| holds at least 57 bits, or all remaining input
+  // bits, so it must cover the (at most 32) requested bits.
+  DCHECK_GE(num_buffered_bits_, num_bits);
 
-  *out = ret;
+  *out = static_cast<uint32_t>(buffer_ >> (64 - num_bits));
+  buffer_ <<= num_bits;
+  num_buffered_bits_ -= num_bits;
   return true;
 }
 
@@ -116,16 +158,35 @@ bool PreloadDecoder::BitReader::DecodeSize(size_t* out) {
       NOTREACHED();
       return false;
   }
+  // The remainder of the value is encoded as a run of 1 bits followed by a
+  // terminating 0. Count the run with count-leading-zeros on the inverted
+  // buffer rather than testing one bit per iteration.
   size_t bit_length = 3;
-  while (true) {
-    bit_length++;
-    bool bit;
-    if (!Next(&bit)) {
+  for (;;) {
+    if (num_buffered_bits_ == 0) {
+      Refill();
+    }
+    const size_t valid_bits =
+        std::min<size_t>(num_buffered_bits_, remaining_bits());
+    if (valid_bits == 0) {
       return false;
     }
-    if (!bit) {
-      break;
+    const size_t ones = base::bits::CountLeadingZeroBits(~buffer_);
+    if (ones >= valid_bits) {
+      // Every buffered bit is a 1; consume them and refill to look for the
+      // terminating 0. The consumed count can be 64, for which a single
+      // shift would be undefined.
+      bit_length += valid_bits;
+      num_buffered_bits_ -= valid_bits;
+      buffer_ = valid_bits < 64 ? buffer_ << valid_bits : 0;
+      continue;
     }
+    // The run ends within the buffer. Consume the 1s and the 0 after them.
+    const size_t consumed = ones + 1;
+    bit_length += consumed;
+    num_buffered_bits_ -= consumed;
+    buffer_ = consumed < 64 ? buffer_ << consumed : 0;
+    break;
   }
   size_t ret = (bit_length - 2) * 2;
   if (!is_even) {
@@ -135,6 +196,46 @@ bool PreloadDecoder::BitReader::DecodeSize(size_t* out) {
   return true;
 }
 
+// Peek sets the |num_bits| least-significant bits of |*out| to the value of
+// the next |num_bits| bits from the input, without consuming them. It returns
+// false if there are insufficient bits in the input or true otherwise.
+bool PreloadDecoder::BitReader::Peek(unsigned num_bits, uint32_t* out) {
+  DCHECK_LE(num_bits, 32u);
+
+  if (remaining_bits() < num_bits) {
+    return false;
+  }
+  if (num_bits == 0) {
+    *out = 0;
+    return true;
+  }
+  if (num_buffered_bits_ < num_bits) {
+    Refill();
+  }
+  DCHECK_GE(num_buffered_bits_, num_bits);
+
+  *out = static_cast<uint32_t>(buffer_ >> (64 - num_bits));
+  return true;
+}
+
+// Skip advances the current position by |num_bits|. It returns false if there
+// are insufficient bits in the input or true otherwise.
+bool PreloadDecoder::BitReader::Skip(unsigned num_bits) {
+  DCHECK_LE(num_bits, 32u);
+
+  if (remaining_bits() < num_bits) {
+    return false;
+  }
+  if (num_buffered_bits_ < num_bits) {
+    Refill();
+  }
+  DCHECK_GE(num_buffered_bits_, num_bits);
+
+  buffer_ <<= num_bits;
+  num_buffered_bits_ -= num_bits;
+  return true;
+}
+
 // Seek sets the current offest in the input to bit number |offset|. It
 // returns true if |offset| is within the range of the input and false
 // otherwise.
@@ -142,20 +243,112 @@ bool PreloadDecoder::BitReader::Seek(size_t offset) {
   if (offset >= num_bits_) {
     return false;
   }
-  current_byte_index_ = offset / 8;
-  current_byte_ = bytes_[current_byte_index_++];
-  num_bits_used_ = offset % 8;
+  next_byte_index_ = offset / 8;
+  buffer_ = 0;
+  num_buffered_bits_ = 0;
+  Refill();
+  // Discard the leading bits of the first byte that precede |offset|.
+  buffer_ <<= offset % 8;
+  num_buffered_bits_ -= offset % 8;
   return true;
 }
 
 PreloadDecoder::HuffmanDecoder::HuffmanDecoder(const uint8_t* tree,
                                                size_t tree_bytes)
-    : tree_(tree), tree_bytes_(tree_bytes) {}
+    : tree_(tree), tree_bytes_(tree_bytes) {
+  if (tree_bytes_ < 2) {
+    return;
+  }
+  // Build the lookup table for the root node; FillTableEntries appends
+  // secondary tables for codes longer than kDecodeTableBits as it encounters
+  // them.
+  tables_.push_back(Table{tree_bytes_ - 2, {}});
+  for (size_t i = 0; i < tables_.size(); ++i) {
+    if (!FillTableEntries(i, tables_[i].node_offset, 0, 0)) {
+      // The tree is malformed. Decode will report an error when walking it.
+      tables_.clear();
+      return;
+    }
+  }
+}
+
+PreloadDecoder::HuffmanDecoder::~HuffmanDecoder() = default;
+
+bool PreloadDecoder::HuffmanDecoder::FillTableEntries(size_t table_index,
+                                                      size_t node_offset,
+                                                      unsigned depth,
+                                                      unsigned prefix) {
+  if (node_offset + 1 >= tree_bytes_) {
+    return false;
+  }
+
+  for (unsigned bit = 0; bit < 2; ++bit) {
+    const uint8_t b = tree_[node_offset + bit];
+    const unsigned new_depth = depth + 1;
+    const unsigned new_prefix = (prefix << 1) | bit;
+
+    TableEntry entry;
+    if (b & 0x80) {
+      entry.value = b & 0x7f;
+      entry.bits = new_depth;
+    } else {
+      const size_t child_offset = static_cast<size_t>(b) * 2;
+      if (child_offset >= tree_bytes_) {
+        return false;
+      }
+      if (new_depth < kDecodeTableBits) {
+        if (!FillTableEntries(table_index, child_offset, new_depth,
+                              new_prefix)) {
+          return false;
+        }
+        continue;
+      }
+      // The code is longer than kDecodeTableBits bits; decoding continues in
+      // a secondary table built from the child node. |value| only has room
+      // for 255 table indices, but that limit cannot be reached: the encoded
+      // tree holds at most 128 nodes.
+      DCHECK_LT(tables_.size(), 256u);
+      entry.value = static_cast<uint8_t>(tables_.size());
+      entry.bits = 0;
+      tables_.push_back(Table{child_offset, {}});
+    }
+
+    // Replicate the entry across every table index that begins with
+    // |new_prefix|.
+    const unsigned shift = kDecodeTableBits - new_depth;
+    for (unsigned i = 0; i < (1u << shift); ++i) {
+      tables_[table_index].entries[(new_prefix << shift) | i] = entry;
+    }
+  }
+  return true;
+}
 
 bool PreloadDecoder::HuffmanDecoder::Decode(PreloadDecoder::BitReader* reader,
                                             char* out) const {
   const uint8_t* current = &tree_[tree_bytes_ - 2];
 
+  if (!tables_.empty()) {
+    size_t table_index = 0;
+    uint32_t bits;
+    while (reader->Peek(kDecodeTableBits, &bits)) {
+      const TableEntry& entry = tables_[table_index].entries[bits];
+      if (entry.bits != 0) {
+        if (!reader->Skip(entry.bits)) {
+          return false;
+        }
+        *out = static_cast<char>(entry.value);
+        return true;
+      }
+      if (!reader->Skip(kDecodeTableBits)) {
+        return false;
+      }
+      table_index = entry.value;
+    }
+    // Fewer than kDecodeTableBits bits remain in the input. Resume decoding
+    // bit-by-bit from the node that the current table was built from.
+    current = &tree_[tables_[table_index].node_offset];
+  }
+
   for (;;) {
     bool bit;
     if (!reader->Next(&bit)) {
@@ -184,30 +377,53 @@ PreloadDecoder::PreloadDecoder(const uint8_t* huffman_tree,
                                size_t trie_bits,
                                size_t trie_root_position)
     : huffman_decoder_(huffman_tree, huffman_tree_size),
-      bit_reader_(trie, trie_bits),
+      trie_(trie),
+      trie_bits_(trie_bits),
       trie_root_position_(trie_root_position) {}
 
 PreloadDecoder::~PreloadDecoder() {}
 
 bool PreloadDecoder::Decode(const std::string& search, bool* out_found) {
+  // The reader lives on the stack rather than in the object so that each
+  // Decode() starts from fresh state and the compiler can keep the reader's
+  // bit buffer in registers across the walk below.
+  BitReader bit_reader(trie_, trie_bits_);
   size_t bit_offset = trie_root_position_;
   *out_found = false;
 
+  // The trie matches |search| from its last character to its first. Rather
+  // than striding backwards through |search|, reverse it once up front and
+  // then walk the copy forwards, which keeps the character reads sequential.
+  // A stack buffer covers any valid hostname; longer inputs (which can only
+  // occur for non-hostname data) fall back to a heap copy.
+  constexpr size_t kMaxStackSearchLength = 256;
+  char reversed_buffer[kMaxStackSearchLength];
+  std::string reversed_string;
+  const char* next_char;
+  if (search.size() <= kMaxStackSearchLength) {
+    std::reverse_copy(search.begin(), search.end(), reversed_buffer);
+    next_char = reversed_buffer;
+  } else {
+    reversed_string.assign(search.rbegin(), search.rend());
+    next_char = reversed_string.data();
+  }
+
   // current_search_offset contains one more than the index of the current
   // character in the search keyword that is being considered. It's one greater
   // so that we can represent the position just before the beginning (with
-  // zero).
+  // zero). |next_char| points at the same character in the reversed copy, and
+  // the two advance together.
   size_t current_search_offset = search.size();
 
   for (;;) {
     // Seek to the desired location.
-    if (!bit_reader_.Seek(bit_offset)) {
+    if (!bit_reader.Seek(bit_offset)) {
       return false;
     }
 
     // Decode the length of the common prefix.
     size_t prefix_length;
-    if (!bit_reader_.DecodeSize(&prefix_length)) {
+    if (!bit_reader.DecodeSize(&prefix_length)) {
       return false;
     }
 
@@ -219,13 +435,14 @@ bool PreloadDecoder::Decode(const std::string& search, bool* out_found) {
       }
 
       char c;
-      if (!huffman_decoder_.Decode(&bit_reader_, &c)) {
+      if (!huffman_decoder_.Decode(&bit_reader, &c)) {
         return false;
       }
-      if (search[current_search_offset - 1] != c) {
+      if (*next_char != c) {
         return true;
       }
       current_search_offset--;
+      next_char++;
     }
 
     bool is_first_offset = true;
@@ -234,7 +451,7 @@ bool PreloadDecoder::Decode(const std::string& search, bool* out_found) {
     // Next is the dispatch table.
     for (;;) {
       char c;
-      if (!huffman_decoder_.Decode(&bit_reader_, &c)) {
+      if (!huffman_decoder_.Decode(&bit_reader, &c)) {
         return false;
       }
       if (c == kEndOfTable) {
@@ -243,7 +460,7 @@ bool PreloadDecoder::Decode(const std::string& search, bool* out_found) {
       }
 
       if (c == kEndOfString) {
-        if (!ReadEntry(&bit_reader_, search, current_search_offset,
+        if (!ReadEntry(&bit_reader, search, current_search_offset,
                        out_found)) {
           return false;
         }
@@ -256,7 +473,7 @@ bool PreloadDecoder::Decode(const std::string& search, bool* out_found) {
 
       // The entries in a dispatch table are in order thus we can tell if there
       // will be no match if the current character past the one that we want.
-      if (current_search_offset == 0 || search[current_search_offset - 1] < c) {
+      if (current_search_offset == 0 || *next_char < c) {
         return true;
       }
 
@@ -264,8 +481,8 @@ bool PreloadDecoder::Decode(const std::string& search, bool* out_found) {
         // The first offset is backwards from the current position.
         uint32_t jump_delta_bits;
         uint32_t jump_delta;
-        if (!bit_reader_.Read(5, &jump_delta_bits) ||
-            !bit_reader_.Read(jump_delta_bits, &jump_delta)) {
+        if (!bit_reader.Read(5, &jump_delta_bits) ||
+            !bit_reader.Read(jump_delta_bits, &jump_delta)) {
           return false;
         }
 
@@ -275,22 +492,26 @@ bool PreloadDecoder::Decode(const std::string& search, bool* out_found) {
 
         current_offset = bit_offset - jump_delta;
         is_first_offset = false;
+        // Start loading the candidate target node while the rest of the
+        // dispatch table is decoded; if one of the following characters
+        // matches, the walk jumps near this position.
+        bit_reader.Prefetch(current_offset);
       } else {
         // Subsequent offsets are forward from the target of the first offset.
         uint32_t is_long_jump;
-        if (!bit_reader_.Read(1, &is_long_jump)) {
+        if (!bit_reader.Read(1, &is_long_jump)) {
           return false;
         }
 
         uint32_t jump_delta;
         if (!is_long_jump) {
-          if (!bit_reader_.Read(7, &jump_delta)) {
+          if (!bit_reader.Read(7, &jump_delta)) {
             return false;
           }
         } else {
           uint32_t jump_delta_bits;
-          if (!bit_reader_.Read(4, &jump_delta_bits) ||
-              !bit_reader_.Read(jump_delta_bits + 8, &jump_delta)) {
+          if (!bit_reader.Read(4, &jump_delta_bits) ||
+              !bit_reader.Read(jump_delta_bits + 8, &jump_delta)) {
             return false;
           }
         }
@@ -299,12 +520,14 @@ bool PreloadDecoder::Decode(const std::string& search, bool* out_found) {
         if (current_offset >= bit_offset) {
           return false;
         }
+        bit_reader.Prefetch(current_offset);
       }
 
       DCHECK_LT(0u, current_search_offset);
-      if (search[current_search_offset - 1] == c) {
+      if (*next_char == c) {
         bit_offset = current_offset;
         current_search_offset--;
+        next_char++;
         break;
       }
     }
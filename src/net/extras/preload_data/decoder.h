@@ -8,6 +8,7 @@
 #include <stdint.h>
 
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 
@@ -68,22 +69,56 @@ class PreloadDecoder {
     // number of 1s to append is half the value (rounded down) minus 1.
     bool DecodeSize(size_t* out);
 
+    // Peek sets the |num_bits| least-significant bits of |*out| to the value
+    // of the next |num_bits| bits from the input, without consuming them. It
+    // returns false if there are insufficient bits in the input or true
+    // otherwise.
+    bool Peek(unsigned num_bits, uint32_t* out);
+
+    // Skip advances the current position by |num_bits|. It returns false if
+    // there are insufficient bits in the input or true otherwise.
+    bool Skip(unsigned num_bits);
+
     // Seek sets the current offest in the input to bit number |offset|. It
     // returns true if |offset| is within the range of the input and false
     // otherwise.
     bool Seek(size_t offset);
 
+    // Hints the processor to load the bytes containing bit |offset| into
+    // cache. Decode() uses this to request a trie node's bytes as soon as its
+    // position is known, ahead of the Seek() that will read them. Has no
+    // effect on the reader state.
+    void Prefetch(size_t offset) const {
+#if defined(__GNUC__) || defined(__clang__)
+      if (offset < num_bits_)
+        __builtin_prefetch(bytes_ + offset / 8, 0, 0);
+#endif
+    }
+
    private:
+    // Loads bytes from |bytes_| into |buffer_| until it holds at least 57
+    // bits, or until the input is exhausted.
+    void Refill();
+
+    // Returns the number of bits consumed from the input so far.
+    size_t current_bit_offset() const {
+      return next_byte_index_ * 8 - num_buffered_bits_;
+    }
+
+    // Returns the number of bits of input that have not yet been consumed.
+    size_t remaining_bits() const { return num_bits_ - current_bit_offset(); }
+
     const uint8_t* const bytes_;
     const size_t num_bits_;
     const size_t num_bytes_;
-    // current_byte_index_ contains the current byte offset in |bytes_|.
-    size_t current_byte_index_;
-    // current_byte_ contains the current byte of the input.
-    uint8_t current_byte_;
-    // num_bits_used_ contains the number of bits of |current_byte_| that have
-    // been read.
-    unsigned num_bits_used_;
+    // buffer_ contains the next bits of the input, with the first unconsumed
+    // bit in the most-significant position.
+    uint64_t buffer_;
+    // num_buffered_bits_ contains the number of valid bits in |buffer_|.
+    unsigned num_buffered_bits_;
+    // next_byte_index_ contains the index in |bytes_| of the next byte to be
+    // loaded into |buffer_|.
+    size_t next_byte_index_;
 
     DISALLOW_COPY_AND_ASSIGN(BitReader);
   };
@@ -95,16 +130,58 @@ class PreloadDecoder {
   // value for that position, or else the bottom seven bits contain the index of
   // a node.
   //
-  // The tree is decoded by walking rather than a table-driven approach.
+  // Rather than walking the tree one bit at a time, decoding is table-driven:
+  // the constructor walks the tree once and builds lookup tables that map the
+  // next |kDecodeTableBits| bits of input directly to a decoded value and a
+  // number of bits consumed. Codes longer than |kDecodeTableBits| bits chain
+  // through secondary tables. Walking the tree bit-by-bit remains as a
+  // fallback for the tail of the input, where fewer than |kDecodeTableBits|
+  // bits may be available.
   class HuffmanDecoder {
    public:
     HuffmanDecoder(const uint8_t* tree, size_t tree_bytes);
+    ~HuffmanDecoder();
 
     bool Decode(PreloadDecoder::BitReader* reader, char* out) const;
 
    private:
+    // The number of input bits consumed per table lookup.
+    static constexpr unsigned kDecodeTableBits = 8;
+
+    struct TableEntry {
+      // If |bits| is non-zero, the decoded value for this bit pattern.
+      // Otherwise, the index in |tables_| of the secondary table that decodes
+      // the bits following this pattern.
+      uint8_t value;
+      // The number of bits consumed by this entry (1..kDecodeTableBits), or
+      // zero if the code is longer than kDecodeTableBits and decoding
+      // continues in a secondary table.
+      uint8_t bits;
+    };
+
+    struct Table {
+      // The byte offset in |tree_| of the node this table was built from.
+      // Used to resume bit-by-bit decoding when fewer than kDecodeTableBits
+      // bits remain in the input.
+      size_t node_offset;
+      TableEntry entries[1 << kDecodeTableBits];
+    };
+
+    // Fills the entries of |tables_[table_index]| whose top |depth| bits equal
+    // |prefix| with the decode results of the subtree rooted at byte offset
+    // |node_offset| in |tree_|, appending secondary tables as needed. Returns
+    // false if the tree is malformed.
+    bool FillTableEntries(size_t table_index,
+                          size_t node_offset,
+                          unsigned depth,
+                          unsigned prefix);
+
     const uint8_t* const tree_;
     const size_t tree_bytes_;
+    // Lookup tables built from |tree_|. The table at index 0 corresponds to
+    // the root node. Empty if the tree could not be translated into tables, in
+    // which case Decode falls back to walking the tree.
+    std::vector<Table> tables_;
 
     DISALLOW_COPY_AND_ASSIGN(HuffmanDecoder);
   };
@@ -150,7 +227,12 @@ class PreloadDecoder {
 
  private:
   HuffmanDecoder huffman_decoder_;
-  BitReader bit_reader_;
+
+  // The trie bytes and their length in bits. Decode() constructs a stack-
+  // local BitReader over them for each lookup, rather than keeping reader
+  // state in the object.
+  const uint8_t* const trie_;
+  const size_t trie_bits_;
 
   const size_t trie_root_position_;
 
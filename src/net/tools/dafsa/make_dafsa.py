@@ -416,7 +416,260 @@ def encode(dafsa):
   return output
 
 
-def to_cxx(data):
+# These constants mirror the packed lookup state used by
+# net::FixedSetIncrementalLookup: the low 31 bits of a state are the byte
+# offset of the position in the encoded graph, the top bit is set if that
+# position is a label character (rather than an offset list), and 0x7FFFFFFF
+# means there is no transition.
+FAST_DISPATCH_LABEL_BIT = 1 << 31
+FAST_DISPATCH_NO_STATE = 0x7FFFFFFF
+FAST_DISPATCH_NO_ROW = 0xFF
+
+# State number reported by the generated compiled lookup when the input
+# character has no transition.
+COMPILED_LOOKUP_NO_STATE = 0xFFFFFFFF
+
+# Maximum number of states handled by one generated step function. Larger
+# automata are split so no single switch becomes too big to compile well.
+COMPILED_LOOKUP_STATES_PER_FUNCTION = 1 << 14
+
+
+def interpret_transition(data, state, char_value):
+  """Performs one lookup transition over the encoded byte array.
+
+  This mirrors FixedSetIncrementalLookup::Advance in
+  net/base/lookup_string_in_fixed_set.cc. Returns the packed state reached
+  from |state| by consuming the character |char_value|, or None if there is
+  no such transition.
+  """
+  offset = state & ~FAST_DISPATCH_LABEL_BIT
+  if state & FAST_DISPATCH_LABEL_BIT:
+    # The position is a label character; it must match |char_value|.
+    byte = data[offset]
+    if (byte & 0x7F) != char_value:
+      return None
+    if byte & 0x80:
+      return offset + 1
+    return (offset + 1) | FAST_DISPATCH_LABEL_BIT
+  # The position is a list of offsets of child nodes; scan it for a child
+  # whose first label character matches |char_value|.
+  pos = offset
+  target = offset
+  while True:
+    byte = data[pos]
+    if (byte & 0x60) == 0x60:
+      target += ((byte & 0x1F) << 16) | (data[pos + 1] << 8) | data[pos + 2]
+      pos += 3
+    elif (byte & 0x60) == 0x40:
+      target += ((byte & 0x1F) << 8) | data[pos + 1]
+      pos += 2
+    else:
+      target += byte & 0x3F
+      pos += 1
+    child = data[target]
+    if (child & 0x7F) == char_value:
+      if child & 0x80:
+        return target + 1
+      return (target + 1) | FAST_DISPATCH_LABEL_BIT
+    if byte & 0x80:
+      return None
+
+
+def fast_dispatch_tables(data, max_rows=255):
+  """Builds direct-index dispatch tables for the hottest graph nodes.
+
+  Row 0 describes the root node; further rows describe the states one
+  transition away from the root, which every successful lookup passes
+  through. Returns (states, rows) where states[row][c] is the packed state
+  reached on input character c (or FAST_DISPATCH_NO_STATE) and rows[row][c]
+  is the table row describing that state (or FAST_DISPATCH_NO_ROW).
+  """
+  row_states = [0]
+  for char_value in range(0x20, 0x80):
+    if len(row_states) >= max_rows:
+      break
+    next_state = interpret_transition(data, 0, char_value)
+    if next_state is not None and next_state not in row_states:
+      row_states.append(next_state)
+  state_to_row = dict((state, row) for row, state in enumerate(row_states))
+
+  states = []
+  rows = []
+  for row_state in row_states:
+    state_row = []
+    row_row = []
+    for char_value in range(128):
+      next_state = None
+      if char_value >= 0x20:
+        next_state = interpret_transition(data, row_state, char_value)
+      if next_state is None:
+        state_row.append(FAST_DISPATCH_NO_STATE)
+        row_row.append(FAST_DISPATCH_NO_ROW)
+      else:
+        state_row.append(next_state)
+        row_row.append(state_to_row.get(next_state, FAST_DISPATCH_NO_ROW))
+    states.append(state_row)
+    rows.append(row_row)
+  return states, rows
+
+
+def fast_dispatch_to_cxx(data):
+  """Generates C++ dispatch tables for the hottest nodes of |data|."""
+  states, rows = fast_dispatch_tables(data)
+  text = '\n'
+  text += 'const uint32_t kDafsaFastStates[%d][128] = {\n' % len(states)
+  for state_row in states:
+    text += '  {\n'
+    for i in range(0, 128, 6):
+      text += '    '
+      text += ', '.join('0x%08x' % value for value in state_row[i:i + 6])
+      text += ',\n'
+    text += '  },\n'
+  text += '};\n\n'
+  text += 'const uint8_t kDafsaFastRows[%d][128] = {\n' % len(rows)
+  for row_row in rows:
+    text += '  {\n'
+    for i in range(0, 128, 12):
+      text += '    '
+      text += ', '.join('0x%02x' % value for value in row_row[i:i + 12])
+      text += ',\n'
+    text += '  },\n'
+  text += '};\n'
+  return text
+
+
+def interpret_result(data, state):
+  """Returns the result code stored at the packed state |state|, or None.
+
+  This mirrors FixedSetIncrementalLookup::GetResultForCurrentSequence in
+  net/base/lookup_string_in_fixed_set.cc.
+  """
+  offset = state & ~FAST_DISPATCH_LABEL_BIT
+  if state & FAST_DISPATCH_LABEL_BIT:
+    # The position is a label character; check whether it is a return value.
+    byte = data[offset]
+    if (byte & 0xE0) == 0x80:
+      return byte & 0x1F
+    return None
+  # The position is a list of offsets of child nodes; scan it for a child
+  # whose first byte is a return value.
+  pos = offset
+  target = offset
+  while True:
+    byte = data[pos]
+    if (byte & 0x60) == 0x60:
+      target += ((byte & 0x1F) << 16) | (data[pos + 1] << 8) | data[pos + 2]
+      pos += 3
+    elif (byte & 0x60) == 0x40:
+      target += ((byte & 0x1F) << 8) | data[pos + 1]
+      pos += 2
+    else:
+      target += byte & 0x3F
+      pos += 1
+    child = data[target]
+    if (child & 0xE0) == 0x80:
+      return child & 0x1F
+    if byte & 0x80:
+      return None
+
+
+def compiled_lookup_states(data):
+  """Flattens the encoded graph into numbered single-character states.
+
+  Returns a list of (transitions, result) pairs, indexed by state number,
+  where transitions maps an input character value to the next state number
+  and result is the state's result code or None. State 0 is the start state.
+  """
+  order = [0]
+  index = {0: 0}
+  states = []
+  next_unvisited = 0
+  while next_unvisited < len(order):
+    state = order[next_unvisited]
+    next_unvisited += 1
+    transitions = {}
+    for char_value in range(0x20, 0x80):
+      next_state = interpret_transition(data, state, char_value)
+      if next_state is None:
+        continue
+      if next_state not in index:
+        index[next_state] = len(order)
+        order.append(next_state)
+      transitions[char_value] = index[next_state]
+    states.append((transitions, interpret_result(data, state)))
+  return states
+
+
+def char_literal(char_value):
+  """Returns a C++ character literal for the printable character value."""
+  if chr(char_value) in ("'", '\\'):
+    return "'\\%s'" % chr(char_value)
+  return "'%s'" % chr(char_value)
+
+
+def compiled_lookup_to_cxx(data):
+  """Generates a compiled C++ lookup function equivalent to |data|.
+
+  The automaton is flattened into switches on (state, input character), which
+  the C++ compiler turns into jump tables, so a lookup touches no graph bytes
+  at all. Large automata are split into one step function per
+  COMPILED_LOOKUP_STATES_PER_FUNCTION states to keep the switches at a size
+  compilers handle well.
+  """
+  states = compiled_lookup_states(data)
+  num_chunks = (len(states) + COMPILED_LOOKUP_STATES_PER_FUNCTION -
+                1) // COMPILED_LOOKUP_STATES_PER_FUNCTION
+  text = '\n'
+  text += ('// A compiled form of the byte array above. States are switched\n'
+           '// on directly instead of interpreting the graph bytes; the\n'
+           '// result codes match LookupStringInFixedSet().\n')
+  for chunk in range(num_chunks):
+    begin = chunk * COMPILED_LOOKUP_STATES_PER_FUNCTION
+    end = min(begin + COMPILED_LOOKUP_STATES_PER_FUNCTION, len(states))
+    text += ('static unsigned LookupStringInGeneratedSetStep%d(unsigned '
+             'state, char c) {\n' % chunk)
+    text += '  switch (state) {\n'
+    for state in range(begin, end):
+      transitions = states[state][0]
+      if not transitions:
+        continue
+      text += '    case %du:\n' % state
+      text += '      switch (c) {\n'
+      for char_value in sorted(transitions):
+        text += '        case %s: return %du;\n' % (
+            char_literal(char_value), transitions[char_value])
+      text += '      }\n'
+      text += '      break;\n'
+    text += '  }\n'
+    text += '  return 0x%08Xu;\n' % COMPILED_LOOKUP_NO_STATE
+    text += '}\n\n'
+  text += 'int LookupStringInGeneratedSet(const char* key, '
+  text += 'size_t key_length) {\n'
+  text += '  unsigned state = 0;\n'
+  text += '  for (size_t i = 0; i < key_length; ++i) {\n'
+  if num_chunks == 1:
+    text += '    state = LookupStringInGeneratedSetStep0(state, key[i]);\n'
+  else:
+    text += '    switch (state / %du) {\n' % (
+        COMPILED_LOOKUP_STATES_PER_FUNCTION)
+    for chunk in range(num_chunks):
+      text += ('      case %du: state = LookupStringInGeneratedSetStep%d('
+               'state, key[i]); break;\n' % (chunk, chunk))
+    text += '    }\n'
+  text += '    if (state == 0x%08Xu)\n' % COMPILED_LOOKUP_NO_STATE
+  text += '      return -1;\n'
+  text += '  }\n'
+  text += '  switch (state) {\n'
+  for state, (transitions, result) in enumerate(states):
+    if result is not None:
+      text += '    case %du: return %d;\n' % (state, result)
+  text += '  }\n'
+  text += '  return -1;\n'
+  text += '}\n'
+  return text
+
+
+def to_cxx(data, fast_dispatch=False, emit_cpp=False):
   """Generates C++ code from a list of encoded bytes."""
   text = '/* This file is generated. DO NOT EDIT!\n\n'
   text += 'The byte array encodes effective tld names. See make_dafsa.py for'
@@ -428,15 +681,19 @@ def to_cxx(data):
     text += ', '.join('0x%02x' % byte for byte in data[i:i + 12])
     text += ',\n'
   text += '};\n'
+  if fast_dispatch:
+    text += fast_dispatch_to_cxx(data)
+  if emit_cpp:
+    text += compiled_lookup_to_cxx(data)
   return text
 
 
-def words_to_cxx(words):
+def words_to_cxx(words, fast_dispatch=False, emit_cpp=False):
   """Generates C++ code from a word list"""
   dafsa = to_dafsa(words)
   for fun in (reverse, join_suffixes, reverse, join_suffixes, join_labels):
     dafsa = fun(dafsa)
-  return to_cxx(encode(dafsa))
+  return to_cxx(encode(dafsa), fast_dispatch, emit_cpp)
 
 
 def parse_gperf(infile, reverse):
@@ -464,12 +721,21 @@ def main():
   parser = argparse.ArgumentParser()
   parser.add_argument('--reverse', action='store_const', const=True,
                       default=False)
+  parser.add_argument('--fast-dispatch', action='store_const', const=True,
+                      default=False,
+                      help='additionally emit direct-index dispatch tables '
+                           'for the hottest graph nodes')
+  parser.add_argument('--emit-cpp', action='store_const', const=True,
+                      default=False,
+                      help='additionally emit a compiled switch-based lookup '
+                           'function equivalent to the byte array')
   parser.add_argument('infile', nargs='?', type=argparse.FileType('r'),
                       default=sys.stdin)
   parser.add_argument('outfile', nargs='?', type=argparse.FileType('w'),
                       default=sys.stdout)
   args = parser.parse_args()
-  args.outfile.write(words_to_cxx(parse_gperf(args.infile, args.reverse)))
+  args.outfile.write(words_to_cxx(parse_gperf(args.infile, args.reverse),
+                                  args.fast_dispatch, args.emit_cpp))
   return 0
 
 
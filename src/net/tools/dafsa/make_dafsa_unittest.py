@@ -765,5 +765,107 @@ class ExamplesTest(unittest.TestCase):
       infile, False)), outfile)
 
 
+class FastDispatchTest(unittest.TestCase):
+  # Example 1 from make_dafsa.py: the words "aa, 1" and "a, 2".
+  bytes = [ 0x81, 0xE1, 0x02, 0x81, 0x82, 0x61, 0x81 ]
+
+  def testInterpretTransition(self):
+    """Tests single transitions over the encoded graph."""
+    # From the root, only 'a' has a transition.
+    state = make_dafsa.interpret_transition(self.bytes, 0, ord('a'))
+    self.assertIsNotNone(state)
+    self.assertIsNone(make_dafsa.interpret_transition(self.bytes, 0, ord('b')))
+    # From 'a', another 'a' can be consumed; 'b' cannot.
+    self.assertIsNotNone(
+        make_dafsa.interpret_transition(self.bytes, state, ord('a')))
+    self.assertIsNone(
+        make_dafsa.interpret_transition(self.bytes, state, ord('b')))
+
+  def testTablesMatchInterpreter(self):
+    """Tests that the emitted tables agree with interpret_transition."""
+    states, rows = make_dafsa.fast_dispatch_tables(self.bytes)
+    self.assertEqual(len(states), len(rows))
+    # Row 0 is the root; every other row describes a state reached from it.
+    root_successors = set()
+    for char_value in range(128):
+      state = None
+      if char_value >= 0x20:
+        state = make_dafsa.interpret_transition(self.bytes, 0, char_value)
+      if state is None:
+        self.assertEqual(states[0][char_value],
+                         make_dafsa.FAST_DISPATCH_NO_STATE)
+        self.assertEqual(rows[0][char_value], make_dafsa.FAST_DISPATCH_NO_ROW)
+      else:
+        self.assertEqual(states[0][char_value], state)
+        root_successors.add(state)
+        row = rows[0][char_value]
+        self.assertNotEqual(row, make_dafsa.FAST_DISPATCH_NO_ROW)
+        # The successor's row must describe the successor's transitions.
+        for char_value2 in range(0x20, 0x80):
+          state2 = make_dafsa.interpret_transition(self.bytes, state,
+                                                   char_value2)
+          if state2 is None:
+            self.assertEqual(states[row][char_value2],
+                             make_dafsa.FAST_DISPATCH_NO_STATE)
+          else:
+            self.assertEqual(states[row][char_value2], state2)
+    self.assertEqual(len(states), 1 + len(root_successors))
+
+
+class CompiledLookupTest(unittest.TestCase):
+  # Example 1 from make_dafsa.py: the words "aa, 1" and "a, 2".
+  bytes = [ 0x81, 0xE1, 0x02, 0x81, 0x82, 0x61, 0x81 ]
+
+  def lookup(self, states, word):
+    """Runs a lookup over the flattened states, as the generated C++ does."""
+    state = 0
+    for char in word:
+      transitions = states[state][0]
+      if ord(char) not in transitions:
+        return -1
+      state = transitions[ord(char)]
+    result = states[state][1]
+    return -1 if result is None else result
+
+  def testStatesMatchWords(self):
+    """Tests that walking the flattened states resolves the source words."""
+    states = make_dafsa.compiled_lookup_states(self.bytes)
+    self.assertEqual(self.lookup(states, 'aa'), 1)
+    self.assertEqual(self.lookup(states, 'a'), 2)
+    self.assertEqual(self.lookup(states, 'aaa'), -1)
+    self.assertEqual(self.lookup(states, 'b'), -1)
+    self.assertEqual(self.lookup(states, ''), -1)
+
+  def testStatesMatchInterpreter(self):
+    """Tests that every flattened transition agrees with the interpreter."""
+    states = make_dafsa.compiled_lookup_states(self.bytes)
+    # Re-walk the packed states in the same discovery order as
+    # compiled_lookup_states and compare each state's transitions.
+    packed = [0]
+    for number, (transitions, result) in enumerate(states):
+      self.assertEqual(result,
+                       make_dafsa.interpret_result(self.bytes, packed[number]))
+      for char_value in range(0x20, 0x80):
+        next_packed = make_dafsa.interpret_transition(self.bytes,
+                                                      packed[number],
+                                                      char_value)
+        if next_packed is None:
+          self.assertNotIn(char_value, transitions)
+        else:
+          if transitions[char_value] == len(packed):
+            packed.append(next_packed)
+          self.assertEqual(packed[transitions[char_value]], next_packed)
+
+  def testEmittedFunction(self):
+    """Tests the shape of the emitted compiled lookup function."""
+    source = make_dafsa.words_to_cxx([ 'aa1', 'a2' ], emit_cpp=True)
+    self.assertIn('int LookupStringInGeneratedSet(const char* key, '
+                  'size_t key_length)', source)
+    self.assertIn('static unsigned LookupStringInGeneratedSetStep0(', source)
+    # The byte array is still emitted for interpreted consumers.
+    self.assertIn('const unsigned char kDafsa', source)
+
+
+
 if __name__ == '__main__':
   unittest.main()